@@ -0,0 +1,948 @@
+// Decoders for compressed inputs (`sage::decomp`).
+//
+// A decoder reads a .gz / .zst / .xz file with pread(2) and produces its
+// uncompressed bytes front to back. On the way it records seek checkpoints:
+// places where decoding can restart without replaying everything before.
+//
+//   gzip  zran-style. At a deflate block boundary at least `span` output bytes
+//         past the previous checkpoint, keep the input offset, the bit offset
+//         inside that byte and the last 32 KiB of output (the window later
+//         blocks may copy from). Member starts need no window.
+//   zstd  Frame starts (frames decode independently).
+//   xz    Only the start of the file; liblzma's stream decoder does not
+//         report block boundaries.
+//
+// `sage_decomp_pread` restarts at the nearest checkpoint at or before the
+// wanted offset, so once the table exists a random read costs at most about
+// `span` bytes of decoding. The table can be saved and loaded again, which is
+// how a reopened file gets random access without a first pass.
+//
+// Callers may share a decoder between threads (UI + fill task); every entry
+// point takes the decoder's mutex.
+//
+// zlib is linked; libzstd and liblzma are dlopen'ed the first time a file
+// needs them, so the binary starts (and reads plain and gzip files) on
+// systems without them. When a library is missing its format is reported as
+// `SAGE_DECOMP_NONE`, as in builds without that codec.
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#if !defined(SAGE_DECOMP_NO_XZ)
+#include <lzma.h>
+#endif
+
+#if !defined(SAGE_DECOMP_NO_ZSTD)
+#if defined(__has_include)
+#if __has_include(<zstd.h>)
+#include <zstd.h>
+#define SAGE_DECOMP_HAVE_ZSTD_H 1
+#endif
+#endif
+#if !defined(SAGE_DECOMP_HAVE_ZSTD_H)
+// Types of the stable streaming API of libzstd (v1.0+), for systems that
+// ship the shared library without headers.
+typedef struct ZSTD_DCtx_s ZSTD_DStream;
+typedef struct { const void *src; size_t size; size_t pos; } ZSTD_inBuffer;
+typedef struct { void *dst; size_t size; size_t pos; } ZSTD_outBuffer;
+#endif
+#endif
+
+#if defined(__APPLE__)
+#define SAGE_DECOMP_ZSTD_LIB "libzstd.1.dylib"
+#define SAGE_DECOMP_XZ_LIB "liblzma.5.dylib"
+#else
+#define SAGE_DECOMP_ZSTD_LIB "libzstd.so.1"
+#define SAGE_DECOMP_XZ_LIB "liblzma.so.5"
+#endif
+
+#if !defined(SAGE_DECOMP_NO_ZSTD)
+static struct {
+  ZSTD_DStream *(*create)(void);
+  size_t (*free_stream)(ZSTD_DStream *zds);
+  size_t (*init)(ZSTD_DStream *zds);
+  size_t (*decompress)(ZSTD_DStream *zds, ZSTD_outBuffer *output, ZSTD_inBuffer *input);
+  unsigned (*is_error)(size_t code);
+} sage_zstd;
+static int sage_zstd_ok;
+static pthread_once_t sage_zstd_once = PTHREAD_ONCE_INIT;
+
+static void sage_zstd_load(void) {
+  void *h = dlopen(SAGE_DECOMP_ZSTD_LIB, RTLD_NOW | RTLD_LOCAL);
+  if (h == NULL) {
+    return;
+  }
+
+  *(void **)&sage_zstd.create = dlsym(h, "ZSTD_createDStream");
+  *(void **)&sage_zstd.free_stream = dlsym(h, "ZSTD_freeDStream");
+  *(void **)&sage_zstd.init = dlsym(h, "ZSTD_initDStream");
+  *(void **)&sage_zstd.decompress = dlsym(h, "ZSTD_decompressStream");
+  *(void **)&sage_zstd.is_error = dlsym(h, "ZSTD_isError");
+  if (sage_zstd.create == NULL || sage_zstd.free_stream == NULL || sage_zstd.init == NULL ||
+      sage_zstd.decompress == NULL || sage_zstd.is_error == NULL) {
+    dlclose(h);
+    return;
+  }
+
+  // The handle stays open for the life of the process.
+  sage_zstd_ok = 1;
+}
+
+static int sage_zstd_available(void) {
+  pthread_once(&sage_zstd_once, sage_zstd_load);
+  return sage_zstd_ok;
+}
+#endif
+
+#if !defined(SAGE_DECOMP_NO_XZ)
+static struct {
+  lzma_ret (*stream_decoder)(lzma_stream *strm, uint64_t memlimit, uint32_t flags);
+  lzma_ret (*code)(lzma_stream *strm, lzma_action action);
+  void (*end)(lzma_stream *strm);
+} sage_xz;
+static int sage_xz_ok;
+static pthread_once_t sage_xz_once = PTHREAD_ONCE_INIT;
+
+static void sage_xz_load(void) {
+  void *h = dlopen(SAGE_DECOMP_XZ_LIB, RTLD_NOW | RTLD_LOCAL);
+  if (h == NULL) {
+    return;
+  }
+
+  *(void **)&sage_xz.stream_decoder = dlsym(h, "lzma_stream_decoder");
+  *(void **)&sage_xz.code = dlsym(h, "lzma_code");
+  *(void **)&sage_xz.end = dlsym(h, "lzma_end");
+  if (sage_xz.stream_decoder == NULL || sage_xz.code == NULL || sage_xz.end == NULL) {
+    dlclose(h);
+    return;
+  }
+
+  sage_xz_ok = 1;
+}
+
+static int sage_xz_available(void) {
+  pthread_once(&sage_xz_once, sage_xz_load);
+  return sage_xz_ok;
+}
+#endif
+
+#define SAGE_DECOMP_NONE 0
+#define SAGE_DECOMP_GZIP 1
+#define SAGE_DECOMP_ZSTD 2
+#define SAGE_DECOMP_XZ 3
+
+#define SAGE_DECOMP_IN_BYTES 65536
+#define SAGE_DECOMP_WINDOW 32768
+#define SAGE_DECOMP_SCRATCH 65536
+
+// Saved table: "SAGEZIX1", then u32 kind, u32 count, i64 total, i64 span and
+// `count` points of {i64 in_off, i64 out_off, i32 bits, u32 win_len, window}.
+static const char SAGE_DECOMP_MAGIC[8] = { 'S', 'A', 'G', 'E', 'Z', 'I', 'X', '1' };
+
+typedef struct {
+  int64_t in_off;   // first compressed byte to feed (see `bits`)
+  int64_t out_off;  // uncompressed offset decoding resumes at
+  int32_t bits;     // gzip: unused bits of byte in_off-1 (0..7); -1 at a member start
+  uint32_t win_len; // gzip: bytes in `window`
+  uint8_t *window;  // gzip: output preceding out_off (at most 32 KiB)
+} SageDecompPoint;
+
+typedef struct {
+  pthread_mutex_t mu;
+  int kind;
+  int fd;
+  int64_t span;
+
+  uint8_t in[SAGE_DECOMP_IN_BYTES];
+  size_t in_len;
+  size_t in_pos;
+  int64_t in_next; // file offset of the next pread
+  int in_eof;
+
+  int64_t out_off;
+  int64_t total; // uncompressed size once known, else -1
+  int done;
+  int failed;
+
+  // Last 32 KiB of output (ring), for gzip checkpoints.
+  uint8_t ring[SAGE_DECOMP_WINDOW];
+  size_t ring_pos;
+  size_t ring_fill;
+
+  z_stream zs;
+  int zs_live;
+  int gz_raw; // restarted mid-member: no header/trailer processing
+
+#if !defined(SAGE_DECOMP_NO_XZ)
+  lzma_stream xs;
+  int xs_live;
+#endif
+
+#if !defined(SAGE_DECOMP_NO_ZSTD)
+  ZSTD_DStream *zd;
+  int zd_frame_end; // the last call finished a frame
+#endif
+
+  SageDecompPoint *pts;
+  int64_t n_pts;
+  int64_t cap_pts;
+
+  uint8_t *scratch;
+} SageDecomp;
+
+// Compression format from the first bytes of a file.
+int sage_decomp_kind(const uint8_t *p, int64_t n) {
+  if (p == NULL || n < 2) {
+    return SAGE_DECOMP_NONE;
+  }
+
+  if (n >= 3 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8) {
+    return SAGE_DECOMP_GZIP;
+  }
+
+  if (n >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd) {
+#if defined(SAGE_DECOMP_NO_ZSTD)
+    return SAGE_DECOMP_NONE;
+#else
+    return sage_zstd_available() ? SAGE_DECOMP_ZSTD : SAGE_DECOMP_NONE;
+#endif
+  }
+
+  if (n >= 6 && p[0] == 0xfd && p[1] == '7' && p[2] == 'z' && p[3] == 'X' && p[4] == 'Z' && p[5] == 0) {
+#if defined(SAGE_DECOMP_NO_XZ)
+    return SAGE_DECOMP_NONE;
+#else
+    return sage_xz_available() ? SAGE_DECOMP_XZ : SAGE_DECOMP_NONE;
+#endif
+  }
+
+  return SAGE_DECOMP_NONE;
+}
+
+static int64_t sage_decomp_in_consumed(const SageDecomp *d) {
+  return d->in_next - (int64_t)(d->in_len - d->in_pos);
+}
+
+// Refill the input buffer when it is empty; 0 at EOF, -1 on error.
+static int sage_decomp_fill(SageDecomp *d) {
+  if (d->in_pos < d->in_len) {
+    return 1;
+  }
+
+  if (d->in_eof) {
+    return 0;
+  }
+
+  ssize_t r;
+  do {
+    r = pread(d->fd, d->in, sizeof d->in, d->in_next);
+  } while (r < 0 && errno == EINTR);
+  if (r < 0) {
+    return -1;
+  }
+
+  d->in_len = (size_t)r;
+  d->in_pos = 0;
+  d->in_next += r;
+  if (r == 0) {
+    d->in_eof = 1;
+    return 0;
+  }
+
+  return 1;
+}
+
+static void sage_decomp_in_reset(SageDecomp *d, int64_t off) {
+  d->in_len = 0;
+  d->in_pos = 0;
+  d->in_next = off;
+  d->in_eof = 0;
+}
+
+static void sage_decomp_ring_push(SageDecomp *d, const uint8_t *p, size_t n) {
+  if (n >= SAGE_DECOMP_WINDOW) {
+    memcpy(d->ring, p + n - SAGE_DECOMP_WINDOW, SAGE_DECOMP_WINDOW);
+    d->ring_pos = 0;
+    d->ring_fill = SAGE_DECOMP_WINDOW;
+    return;
+  }
+
+  size_t first = SAGE_DECOMP_WINDOW - d->ring_pos;
+  if (first > n) {
+    first = n;
+  }
+
+  memcpy(d->ring + d->ring_pos, p, first);
+  memcpy(d->ring, p + first, n - first);
+  d->ring_pos = (d->ring_pos + n) % SAGE_DECOMP_WINDOW;
+  d->ring_fill = d->ring_fill + n > SAGE_DECOMP_WINDOW ? SAGE_DECOMP_WINDOW : d->ring_fill + n;
+}
+
+// Ring contents, oldest first.
+static void sage_decomp_ring_copy(const SageDecomp *d, uint8_t *out) {
+  size_t start = (d->ring_pos + SAGE_DECOMP_WINDOW - d->ring_fill) % SAGE_DECOMP_WINDOW;
+  size_t first = SAGE_DECOMP_WINDOW - start;
+  if (first > d->ring_fill) {
+    first = d->ring_fill;
+  }
+
+  memcpy(out, d->ring + start, first);
+  memcpy(out + first, d->ring, d->ring_fill - first);
+}
+
+static void sage_decomp_ring_set(SageDecomp *d, const uint8_t *p, size_t n) {
+  d->ring_pos = 0;
+  d->ring_fill = 0;
+  if (n > 0) {
+    sage_decomp_ring_push(d, p, n);
+  }
+}
+
+// Record a checkpoint at the current position. Only positions past the last
+// one count, so decoding a region again after a seek adds nothing.
+static void sage_decomp_add_point(SageDecomp *d, int64_t in_off, int32_t bits, int with_window) {
+  if (d->n_pts > 0) {
+    const SageDecompPoint *last = &d->pts[d->n_pts - 1];
+    if (d->out_off <= last->out_off || d->out_off - last->out_off < d->span) {
+      return;
+    }
+  }
+
+  if (d->n_pts == d->cap_pts) {
+    int64_t cap = d->cap_pts ? d->cap_pts * 2 : 64;
+    SageDecompPoint *np = realloc(d->pts, (size_t)cap * sizeof *np);
+    if (np == NULL) {
+      return;
+    }
+
+    d->pts = np;
+    d->cap_pts = cap;
+  }
+
+  SageDecompPoint *pt = &d->pts[d->n_pts];
+  pt->in_off = in_off;
+  pt->out_off = d->out_off;
+  pt->bits = bits;
+  pt->win_len = 0;
+  pt->window = NULL;
+  if (with_window && d->ring_fill > 0) {
+    pt->window = malloc(d->ring_fill);
+    if (pt->window == NULL) {
+      return;
+    }
+
+    sage_decomp_ring_copy(d, pt->window);
+    pt->win_len = (uint32_t)d->ring_fill;
+  }
+
+  d->n_pts++;
+}
+
+static void sage_decomp_end_codec(SageDecomp *d) {
+  if (d->zs_live) {
+    inflateEnd(&d->zs);
+    d->zs_live = 0;
+  }
+
+#if !defined(SAGE_DECOMP_NO_XZ)
+  if (d->xs_live) {
+    sage_xz.end(&d->xs);
+    d->xs_live = 0;
+  }
+#endif
+}
+
+// (Re)start the codec at checkpoint `pt` (NULL = start of file).
+static int sage_decomp_restart(SageDecomp *d, const SageDecompPoint *pt) {
+  int64_t in_off = pt ? pt->in_off : 0;
+  d->out_off = pt ? pt->out_off : 0;
+  d->done = 0;
+  d->failed = 0;
+  sage_decomp_ring_set(d, pt ? pt->window : NULL, pt ? pt->win_len : 0);
+
+  if (d->kind == SAGE_DECOMP_GZIP) {
+    int raw = pt != NULL && pt->bits >= 0;
+    int wbits = raw ? -15 : 31;
+    int rc = d->zs_live ? inflateReset2(&d->zs, wbits) : inflateInit2(&d->zs, wbits);
+    if (rc != Z_OK) {
+      return -1;
+    }
+
+    d->zs_live = 1;
+    d->gz_raw = raw;
+    if (raw && pt->bits > 0) {
+      uint8_t b;
+      if (pread(d->fd, &b, 1, in_off - 1) != 1) {
+        return -1;
+      }
+
+      inflatePrime(&d->zs, pt->bits, b >> (8 - pt->bits));
+    }
+
+    if (raw && pt->win_len > 0) {
+      inflateSetDictionary(&d->zs, pt->window, pt->win_len);
+    }
+
+    sage_decomp_in_reset(d, in_off);
+    return 0;
+  }
+
+#if !defined(SAGE_DECOMP_NO_ZSTD)
+  if (d->kind == SAGE_DECOMP_ZSTD) {
+    if (!sage_zstd_available()) {
+      return -1;
+    }
+
+    if (d->zd == NULL) {
+      d->zd = sage_zstd.create();
+      if (d->zd == NULL) {
+        return -1;
+      }
+    }
+
+    if (sage_zstd.is_error(sage_zstd.init(d->zd))) {
+      return -1;
+    }
+
+    d->zd_frame_end = 0;
+    sage_decomp_in_reset(d, in_off);
+    return 0;
+  }
+#endif
+
+#if !defined(SAGE_DECOMP_NO_XZ)
+  if (d->kind == SAGE_DECOMP_XZ) {
+    if (!sage_xz_available()) {
+      return -1;
+    }
+
+    if (d->xs_live) {
+      sage_xz.end(&d->xs);
+      d->xs_live = 0;
+    }
+
+    lzma_stream init = LZMA_STREAM_INIT;
+    d->xs = init;
+    if (sage_xz.stream_decoder(&d->xs, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+      return -1;
+    }
+
+    d->xs_live = 1;
+    sage_decomp_in_reset(d, 0);
+    d->out_off = 0;
+    sage_decomp_ring_set(d, NULL, 0);
+    return 0;
+  }
+#endif
+
+  return -1;
+}
+
+static void sage_decomp_finish(SageDecomp *d) {
+  d->done = 1;
+  if (d->total < 0 && !d->failed) {
+    d->total = d->out_off;
+  }
+}
+
+// Skip the 8-byte trailer of a member decoded in raw mode.
+static int sage_decomp_skip_trailer(SageDecomp *d) {
+  size_t left = 8;
+  while (left > 0) {
+    int f = sage_decomp_fill(d);
+    if (f <= 0) {
+      return f;
+    }
+
+    size_t n = d->in_len - d->in_pos;
+    if (n > left) {
+      n = left;
+    }
+
+    d->in_pos += n;
+    left -= n;
+  }
+
+  return 1;
+}
+
+// After a gzip member: start the next one if the file continues with one.
+static void sage_decomp_gz_next_member(SageDecomp *d) {
+  if (d->gz_raw && sage_decomp_skip_trailer(d) <= 0) {
+    sage_decomp_finish(d);
+    return;
+  }
+
+  uint8_t magic[2];
+  int64_t at = sage_decomp_in_consumed(d);
+  if (pread(d->fd, magic, 2, at) != 2 || magic[0] != 0x1f || magic[1] != 0x8b) {
+    // Trailing padding (zeros) after the last member is ignored, as gzip does.
+    sage_decomp_finish(d);
+    return;
+  }
+
+  if (inflateReset2(&d->zs, 31) != Z_OK) {
+    d->failed = 1;
+    sage_decomp_finish(d);
+    return;
+  }
+
+  d->gz_raw = 0;
+  sage_decomp_add_point(d, at, -1, 0);
+}
+
+static int64_t sage_decomp_read_gzip(SageDecomp *d, uint8_t *out, int64_t cap) {
+  int64_t got = 0;
+  while (got < cap && !d->done) {
+    int f = sage_decomp_fill(d);
+    if (f < 0) {
+      d->failed = 1;
+      break;
+    }
+
+    if (f == 0) {
+      // Truncated member: keep what was decoded.
+      d->failed = 1;
+      sage_decomp_finish(d);
+      break;
+    }
+
+    uInt room = (uInt)((cap - got) > (1 << 30) ? (1 << 30) : (cap - got));
+    d->zs.next_in = d->in + d->in_pos;
+    d->zs.avail_in = (uInt)(d->in_len - d->in_pos);
+    d->zs.next_out = out + got;
+    d->zs.avail_out = room;
+    int rc = inflate(&d->zs, Z_BLOCK);
+    size_t produced = room - d->zs.avail_out;
+    d->in_pos = d->in_len - d->zs.avail_in;
+    if (produced > 0) {
+      sage_decomp_ring_push(d, out + got, produced);
+      got += (int64_t)produced;
+      d->out_off += (int64_t)produced;
+    }
+
+    if (rc == Z_STREAM_END) {
+      sage_decomp_gz_next_member(d);
+      continue;
+    }
+
+    if (rc != Z_OK && rc != Z_BUF_ERROR) {
+      d->failed = 1;
+      sage_decomp_finish(d);
+      break;
+    }
+
+    // Bit 7: end of a block (or of the header); bit 6: it was the last one.
+    if ((d->zs.data_type & 128) && !(d->zs.data_type & 64) && d->out_off > 0) {
+      sage_decomp_add_point(d, sage_decomp_in_consumed(d), d->zs.data_type & 7, 1);
+    }
+  }
+
+  return got;
+}
+
+#if !defined(SAGE_DECOMP_NO_ZSTD)
+static int64_t sage_decomp_read_zstd(SageDecomp *d, uint8_t *out, int64_t cap) {
+  int64_t got = 0;
+  while (got < cap && !d->done) {
+    int f = sage_decomp_fill(d);
+    if (f < 0) {
+      d->failed = 1;
+      break;
+    }
+
+    if (f == 0) {
+      if (!d->zd_frame_end && d->out_off > 0) {
+        d->failed = 1; // truncated frame
+      }
+
+      sage_decomp_finish(d);
+      break;
+    }
+
+    if (d->zd_frame_end) {
+      d->zd_frame_end = 0;
+      sage_decomp_add_point(d, sage_decomp_in_consumed(d), 0, 0);
+    }
+
+    ZSTD_inBuffer ib = { d->in, d->in_len, d->in_pos };
+    ZSTD_outBuffer ob = { out + got, (size_t)(cap - got), 0 };
+    size_t rc = sage_zstd.decompress(d->zd, &ob, &ib);
+    d->in_pos = ib.pos;
+    got += (int64_t)ob.pos;
+    d->out_off += (int64_t)ob.pos;
+    if (sage_zstd.is_error(rc)) {
+      d->failed = 1;
+      sage_decomp_finish(d);
+      break;
+    }
+
+    if (rc == 0) {
+      d->zd_frame_end = 1;
+    }
+  }
+
+  return got;
+}
+#endif
+
+#if !defined(SAGE_DECOMP_NO_XZ)
+static int64_t sage_decomp_read_xz(SageDecomp *d, uint8_t *out, int64_t cap) {
+  int64_t got = 0;
+  while (got < cap && !d->done) {
+    int f = sage_decomp_fill(d);
+    if (f < 0) {
+      d->failed = 1;
+      break;
+    }
+
+    d->xs.next_in = d->in + d->in_pos;
+    d->xs.avail_in = d->in_len - d->in_pos;
+    d->xs.next_out = out + got;
+    d->xs.avail_out = (size_t)(cap - got);
+    lzma_ret rc = sage_xz.code(&d->xs, f == 0 ? LZMA_FINISH : LZMA_RUN);
+    size_t produced = (size_t)(cap - got) - d->xs.avail_out;
+    d->in_pos = d->in_len - d->xs.avail_in;
+    got += (int64_t)produced;
+    d->out_off += (int64_t)produced;
+    if (rc == LZMA_STREAM_END) {
+      sage_decomp_finish(d);
+      break;
+    }
+
+    if (rc != LZMA_OK) {
+      d->failed = 1;
+      sage_decomp_finish(d);
+      break;
+    }
+
+    if (f == 0 && produced == 0) {
+      d->failed = 1; // truncated stream
+      sage_decomp_finish(d);
+      break;
+    }
+  }
+
+  return got;
+}
+#endif
+
+static int64_t sage_decomp_read_locked(SageDecomp *d, uint8_t *out, int64_t cap) {
+  if (cap <= 0 || d->done) {
+    return 0;
+  }
+
+  switch (d->kind) {
+  case SAGE_DECOMP_GZIP:
+    return sage_decomp_read_gzip(d, out, cap);
+#if !defined(SAGE_DECOMP_NO_ZSTD)
+  case SAGE_DECOMP_ZSTD:
+    return sage_decomp_read_zstd(d, out, cap);
+#endif
+#if !defined(SAGE_DECOMP_NO_XZ)
+  case SAGE_DECOMP_XZ:
+    return sage_decomp_read_xz(d, out, cap);
+#endif
+  default:
+    return -1;
+  }
+}
+
+// Position the decoder at uncompressed offset `off`: restart at the nearest
+// checkpoint unless continuing from the current position is closer.
+static int sage_decomp_seek_locked(SageDecomp *d, int64_t off) {
+  if (off == d->out_off && !d->failed) {
+    return 0;
+  }
+
+  const SageDecompPoint *best = NULL;
+  int64_t lo = 0;
+  int64_t hi = d->n_pts;
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    if (d->pts[mid].out_off <= off) {
+      best = &d->pts[mid];
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  int64_t best_off = best ? best->out_off : 0;
+  int forward = !d->failed && d->out_off <= off && d->out_off >= best_off;
+  if (!forward && sage_decomp_restart(d, best) != 0) {
+    d->failed = 1;
+    return -1;
+  }
+
+  while (d->out_off < off && !d->done) {
+    int64_t want = off - d->out_off;
+    int64_t n = sage_decomp_read_locked(d, d->scratch, want < SAGE_DECOMP_SCRATCH ? want : SAGE_DECOMP_SCRATCH);
+    if (n <= 0) {
+      break;
+    }
+  }
+
+  return d->out_off == off ? 0 : -1;
+}
+
+/**
+ * Open a decoder over `fd` (read with pread only). On success the decoder
+ * owns `fd` and closes it in `sage_decomp_free`. `span` is the minimum output
+ * distance between checkpoints.
+ */
+void *sage_decomp_open(int fd, int kind, int64_t span) {
+  if (fd < 0 || kind == SAGE_DECOMP_NONE) {
+    return NULL;
+  }
+
+  SageDecomp *d = calloc(1, sizeof *d);
+  if (d == NULL) {
+    return NULL;
+  }
+
+  d->scratch = malloc(SAGE_DECOMP_SCRATCH);
+  if (d->scratch == NULL) {
+    free(d);
+    return NULL;
+  }
+
+  pthread_mutex_init(&d->mu, NULL);
+  d->kind = kind;
+  d->fd = fd;
+  d->span = span > 0 ? span : 1;
+  d->total = -1;
+  if (sage_decomp_restart(d, NULL) != 0) {
+    sage_decomp_end_codec(d);
+    free(d->scratch);
+    free(d);
+    return NULL;
+  }
+
+  sage_decomp_add_point(d, 0, -1, 0);
+  return d;
+}
+
+void sage_decomp_free(void *h) {
+  SageDecomp *d = h;
+  if (d == NULL) {
+    return;
+  }
+
+  sage_decomp_end_codec(d);
+#if !defined(SAGE_DECOMP_NO_ZSTD)
+  if (d->zd != NULL) {
+    sage_zstd.free_stream(d->zd);
+  }
+#endif
+  for (int64_t i = 0; i < d->n_pts; i++) {
+    free(d->pts[i].window);
+  }
+
+  free(d->pts);
+  free(d->scratch);
+  close(d->fd);
+  pthread_mutex_destroy(&d->mu);
+  free(d);
+}
+
+// Decode the next bytes into `out`: count, 0 at the end, -1 on error.
+int64_t sage_decomp_read(void *h, uint8_t *out, int64_t cap) {
+  SageDecomp *d = h;
+  if (d == NULL || out == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&d->mu);
+  int64_t n = sage_decomp_read_locked(d, out, cap);
+  int failed = d->failed;
+  pthread_mutex_unlock(&d->mu);
+  return n > 0 ? n : (failed ? -1 : n);
+}
+
+// Up to `n` bytes at uncompressed offset `off`: count (short at the end),
+// or -1 on error.
+int64_t sage_decomp_pread(void *h, uint8_t *out, int64_t n, int64_t off) {
+  SageDecomp *d = h;
+  if (d == NULL || out == NULL || off < 0) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&d->mu);
+  int64_t got = -1;
+  if (sage_decomp_seek_locked(d, off) == 0) {
+    got = 0;
+    while (got < n && !d->done) {
+      int64_t r = sage_decomp_read_locked(d, out + got, n - got);
+      if (r <= 0) {
+        break;
+      }
+
+      got += r;
+    }
+
+    if (got < n && d->failed) {
+      got = -1;
+    }
+  }
+
+  pthread_mutex_unlock(&d->mu);
+  return got;
+}
+
+// Uncompressed size: known after a full pass or a loaded table, else -1.
+int64_t sage_decomp_total(void *h) {
+  SageDecomp *d = h;
+  if (d == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&d->mu);
+  int64_t t = d->total;
+  pthread_mutex_unlock(&d->mu);
+  return t;
+}
+
+int64_t sage_decomp_points(void *h) {
+  SageDecomp *d = h;
+  if (d == NULL) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&d->mu);
+  int64_t n = d->n_pts;
+  pthread_mutex_unlock(&d->mu);
+  return n;
+}
+
+static void sage_decomp_put(uint8_t *buf, int64_t cap, int64_t *at, const void *p, size_t n) {
+  if (*at + (int64_t)n <= cap) {
+    memcpy(buf + *at, p, n);
+  }
+
+  *at += (int64_t)n;
+}
+
+/**
+ * Serialise the checkpoint table (only once the total size is known).
+ * Returns the bytes needed; `buf` is written only when `cap` is enough.
+ */
+int64_t sage_decomp_save(void *h, uint8_t *buf, int64_t cap) {
+  SageDecomp *d = h;
+  if (d == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&d->mu);
+  if (d->total < 0) {
+    pthread_mutex_unlock(&d->mu);
+    return -1;
+  }
+
+  int64_t at = 0;
+  uint32_t kind = (uint32_t)d->kind;
+  uint32_t count = (uint32_t)d->n_pts;
+  sage_decomp_put(buf, cap, &at, SAGE_DECOMP_MAGIC, sizeof SAGE_DECOMP_MAGIC);
+  sage_decomp_put(buf, cap, &at, &kind, sizeof kind);
+  sage_decomp_put(buf, cap, &at, &count, sizeof count);
+  sage_decomp_put(buf, cap, &at, &d->total, sizeof d->total);
+  sage_decomp_put(buf, cap, &at, &d->span, sizeof d->span);
+  for (int64_t i = 0; i < d->n_pts; i++) {
+    const SageDecompPoint *pt = &d->pts[i];
+    sage_decomp_put(buf, cap, &at, &pt->in_off, sizeof pt->in_off);
+    sage_decomp_put(buf, cap, &at, &pt->out_off, sizeof pt->out_off);
+    sage_decomp_put(buf, cap, &at, &pt->bits, sizeof pt->bits);
+    sage_decomp_put(buf, cap, &at, &pt->win_len, sizeof pt->win_len);
+    if (pt->win_len > 0) {
+      sage_decomp_put(buf, cap, &at, pt->window, pt->win_len);
+    }
+  }
+
+  pthread_mutex_unlock(&d->mu);
+  return at;
+}
+
+static int sage_decomp_get(const uint8_t *buf, int64_t len, int64_t *at, void *p, size_t n) {
+  if (*at + (int64_t)n > len) {
+    return -1;
+  }
+
+  memcpy(p, buf + *at, n);
+  *at += (int64_t)n;
+  return 0;
+}
+
+/**
+ * Replace the checkpoint table with one from `sage_decomp_save`. Returns 0,
+ * or -1 when the table is malformed or for another format.
+ */
+int sage_decomp_load(void *h, const uint8_t *buf, int64_t len) {
+  SageDecomp *d = h;
+  if (d == NULL || buf == NULL) {
+    return -1;
+  }
+
+  int64_t at = 0;
+  char magic[8];
+  uint32_t kind = 0;
+  uint32_t count = 0;
+  int64_t total = -1;
+  int64_t span = 0;
+  if (sage_decomp_get(buf, len, &at, magic, sizeof magic) != 0 || memcmp(magic, SAGE_DECOMP_MAGIC, sizeof magic) != 0
+      || sage_decomp_get(buf, len, &at, &kind, sizeof kind) != 0 || sage_decomp_get(buf, len, &at, &count, sizeof count) != 0
+      || sage_decomp_get(buf, len, &at, &total, sizeof total) != 0 || sage_decomp_get(buf, len, &at, &span, sizeof span) != 0
+      || (int)kind != d->kind || total < 0 || count == 0) {
+    return -1;
+  }
+
+  SageDecompPoint *pts = calloc(count, sizeof *pts);
+  if (pts == NULL) {
+    return -1;
+  }
+
+  int ok = 1;
+  for (uint32_t i = 0; i < count && ok; i++) {
+    SageDecompPoint *pt = &pts[i];
+    ok = sage_decomp_get(buf, len, &at, &pt->in_off, sizeof pt->in_off) == 0
+         && sage_decomp_get(buf, len, &at, &pt->out_off, sizeof pt->out_off) == 0
+         && sage_decomp_get(buf, len, &at, &pt->bits, sizeof pt->bits) == 0
+         && sage_decomp_get(buf, len, &at, &pt->win_len, sizeof pt->win_len) == 0
+         && pt->win_len <= SAGE_DECOMP_WINDOW && pt->bits >= -1 && pt->bits <= 7
+         && pt->out_off >= 0 && pt->out_off <= total && (i == 0 || pt->out_off > pts[i - 1].out_off);
+    if (ok && pt->win_len > 0) {
+      pt->window = malloc(pt->win_len);
+      ok = pt->window != NULL && sage_decomp_get(buf, len, &at, pt->window, pt->win_len) == 0;
+    }
+  }
+
+  if (!ok) {
+    for (uint32_t i = 0; i < count; i++) {
+      free(pts[i].window);
+    }
+
+    free(pts);
+    return -1;
+  }
+
+  pthread_mutex_lock(&d->mu);
+  for (int64_t i = 0; i < d->n_pts; i++) {
+    free(d->pts[i].window);
+  }
+
+  free(d->pts);
+  d->pts = pts;
+  d->n_pts = count;
+  d->cap_pts = count;
+  d->total = total;
+  d->span = span > 0 ? span : d->span;
+  pthread_mutex_unlock(&d->mu);
+  return 0;
+}
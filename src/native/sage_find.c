@@ -0,0 +1,280 @@
+// Literal substring search for `/`, `n` and `p` (`sage::find`).
+//
+// Candidates come from a rare-pair prefilter: the two needle bytes least
+// likely to occur in text are compared against 16 haystack positions at a
+// time, and only positions where both agree are verified. With ASCII case
+// folding each of the two bytes is compared against both of its cases, and
+// the verify step folds 16 bytes per step, so `-i` costs about the same as
+// an exact search.
+//
+// Reverse search walks the same blocks from the end and takes the highest
+// candidate first; `sage_find_byte_rev` is the single-byte case (`memrchr`,
+// which not every libc has).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SAGE_FIND_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SAGE_FIND_NEON 1
+#endif
+
+#define SAGE_FIND_BLOCK 16
+
+static inline uint8_t sage_find_fold(uint8_t b) {
+  return (b >= 'A' && b <= 'Z') ? (uint8_t)(b + 32) : b;
+}
+
+static inline uint8_t sage_find_other_case(uint8_t b) {
+  if (b >= 'a' && b <= 'z') {
+    return (uint8_t)(b - 32);
+  }
+  if (b >= 'A' && b <= 'Z') {
+    return (uint8_t)(b + 32);
+  }
+  return b;
+}
+
+// How common `b` is in typical text (higher = more common). Only the order
+// matters: the prefilter keys on the two needle bytes with the lowest score.
+static int sage_find_commonness(uint8_t b, int nocase) {
+  static const char by_freq[] = "etaoinshrdlcumwfgypbvkjxqz";
+  if (b == ' ') {
+    return 255;
+  }
+  if (b == '\n' || b == '\t') {
+    return 180;
+  }
+
+  uint8_t l = sage_find_fold(b);
+  if (l >= 'a' && l <= 'z') {
+    int rank = (int)(strchr(by_freq, l) - by_freq);
+    int score = 240 - (rank * 7);
+    // In exact search an uppercase letter is rarer than its lowercase one.
+    return (!nocase && b != l) ? score / 3 : score;
+  }
+  if (b >= '0' && b <= '9') {
+    return 120;
+  }
+  if (strchr(".,;:\"'()-_=/<>{}[]", b) != NULL && b != 0) {
+    return 110;
+  }
+  if (b >= 0x80) {
+    return 60;
+  }
+  return 30;
+}
+
+// Pick the prefilter positions `*i1 < *i2` (equal when `qlen == 1`).
+static void sage_find_pick_pair(const uint8_t *q, int64_t qlen, int nocase, int64_t *i1, int64_t *i2) {
+  int64_t best = 0;
+  int best_s = 1 << 30;
+  for (int64_t i = 0; i < qlen; i++) {
+    int s = sage_find_commonness(q[i], nocase);
+    if (s < best_s) {
+      best_s = s;
+      best = i;
+    }
+  }
+
+  int64_t second = best;
+  int second_s = 1 << 30;
+  for (int64_t i = 0; i < qlen; i++) {
+    int s = sage_find_commonness(q[i], nocase);
+    // Prefer a different byte value: two equal keys filter no better than one.
+    if (i != best && (s < second_s || (s == second_s && q[i] != q[best]))) {
+      second_s = s;
+      second = i;
+    }
+  }
+
+  *i1 = best < second ? best : second;
+  *i2 = best < second ? second : best;
+}
+
+// `h[0..n)` equals `q[0..n)`, ASCII case-folded when `nocase`.
+static int sage_find_eq(const uint8_t *h, const uint8_t *q, int64_t n, int nocase) {
+  if (!nocase) {
+    return memcmp(h, q, (size_t)n) == 0;
+  }
+
+  int64_t i = 0;
+#if defined(SAGE_FIND_SSE2)
+  const __m128i bias = _mm_set1_epi8((char)(0x80 - 'A'));
+  const __m128i lim = _mm_set1_epi8((char)(-0x80 + 26));
+  const __m128i bit = _mm_set1_epi8(0x20);
+  for (; i + SAGE_FIND_BLOCK <= n; i += SAGE_FIND_BLOCK) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(h + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(q + i));
+    a = _mm_or_si128(a, _mm_and_si128(_mm_cmplt_epi8(_mm_add_epi8(a, bias), lim), bit));
+    b = _mm_or_si128(b, _mm_and_si128(_mm_cmplt_epi8(_mm_add_epi8(b, bias), lim), bit));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF) {
+      return 0;
+    }
+  }
+#elif defined(SAGE_FIND_NEON)
+  const uint8x16_t base = vdupq_n_u8('A');
+  const uint8x16_t span = vdupq_n_u8(26);
+  const uint8x16_t bit = vdupq_n_u8(0x20);
+  for (; i + SAGE_FIND_BLOCK <= n; i += SAGE_FIND_BLOCK) {
+    uint8x16_t a = vld1q_u8(h + i);
+    uint8x16_t b = vld1q_u8(q + i);
+    a = vorrq_u8(a, vandq_u8(vcltq_u8(vsubq_u8(a, base), span), bit));
+    b = vorrq_u8(b, vandq_u8(vcltq_u8(vsubq_u8(b, base), span), bit));
+    if (vminvq_u8(vceqq_u8(a, b)) != 0xFF) {
+      return 0;
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    if (sage_find_fold(h[i]) != sage_find_fold(q[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+typedef struct {
+  uint8_t a0, a1; // both cases of the first key byte (equal when exact)
+  uint8_t b0, b1;
+  int64_t i1, i2;
+} SageFindKeys;
+
+static void sage_find_keys(const uint8_t *q, int64_t qlen, int nocase, SageFindKeys *k) {
+  sage_find_pick_pair(q, qlen, nocase, &k->i1, &k->i2);
+  k->a0 = q[k->i1];
+  k->b0 = q[k->i2];
+  k->a1 = nocase ? sage_find_other_case(k->a0) : k->a0;
+  k->b1 = nocase ? sage_find_other_case(k->b0) : k->b0;
+}
+
+static inline int sage_find_key_at(const uint8_t *p, const SageFindKeys *k) {
+  uint8_t x = p[k->i1];
+  uint8_t y = p[k->i2];
+  return (x == k->a0 || x == k->a1) && (y == k->b0 || y == k->b1);
+}
+
+// Bit `j` set iff position `p + j` passes the prefilter (j in [0, 16)).
+// NEON has no movemask; its mask holds 4 bits per lane instead, hence the
+// `SAGE_FIND_LANE_SHIFT` below.
+#if defined(SAGE_FIND_SSE2)
+#define SAGE_FIND_LANE_SHIFT 0
+static inline uint64_t sage_find_mask16(const uint8_t *p, const SageFindKeys *k) {
+  const __m128i x = _mm_loadu_si128((const __m128i *)(p + k->i1));
+  const __m128i y = _mm_loadu_si128((const __m128i *)(p + k->i2));
+  __m128i ma = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8((char)k->a0)), _mm_cmpeq_epi8(x, _mm_set1_epi8((char)k->a1)));
+  __m128i mb = _mm_or_si128(_mm_cmpeq_epi8(y, _mm_set1_epi8((char)k->b0)), _mm_cmpeq_epi8(y, _mm_set1_epi8((char)k->b1)));
+  return (uint32_t)_mm_movemask_epi8(_mm_and_si128(ma, mb));
+}
+#elif defined(SAGE_FIND_NEON)
+#define SAGE_FIND_LANE_SHIFT 2
+static inline uint64_t sage_find_mask16(const uint8_t *p, const SageFindKeys *k) {
+  const uint8x16_t x = vld1q_u8(p + k->i1);
+  const uint8x16_t y = vld1q_u8(p + k->i2);
+  uint8x16_t ma = vorrq_u8(vceqq_u8(x, vdupq_n_u8(k->a0)), vceqq_u8(x, vdupq_n_u8(k->a1)));
+  uint8x16_t mb = vorrq_u8(vceqq_u8(y, vdupq_n_u8(k->b0)), vceqq_u8(y, vdupq_n_u8(k->b1)));
+  uint8x8_t nib = vshrn_n_u16(vreinterpretq_u16_u8(vandq_u8(ma, mb)), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(nib), 0) & 0x8888888888888888ULL;
+}
+#endif
+
+// Offset of the first match of `q` in `h[0..len)`, or -1.
+int64_t sage_find_fwd(const uint8_t *h, int64_t len, const uint8_t *q, int64_t qlen, int nocase) {
+  if (h == NULL || q == NULL || qlen <= 0 || len < qlen) {
+    return -1;
+  }
+
+  SageFindKeys k;
+  sage_find_keys(q, qlen, nocase, &k);
+  const int64_t last = len - qlen; // last possible match start
+  int64_t i = 0;
+#if defined(SAGE_FIND_SSE2) || defined(SAGE_FIND_NEON)
+  // Loads reach `i + i2 + 15 <= last + qlen - 1 < len`.
+  for (; i + SAGE_FIND_BLOCK - 1 <= last; i += SAGE_FIND_BLOCK) {
+    uint64_t m = sage_find_mask16(h + i, &k);
+    while (m != 0) {
+      int64_t at = i + (__builtin_ctzll(m) >> SAGE_FIND_LANE_SHIFT);
+      if (sage_find_eq(h + at, q, qlen, nocase)) {
+        return at;
+      }
+      m &= m - 1;
+    }
+  }
+#endif
+  for (; i <= last; i++) {
+    if (sage_find_key_at(h + i, &k) && sage_find_eq(h + i, q, qlen, nocase)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Offset of the last match of `q` in `h[0..len)`, or -1.
+int64_t sage_find_rev(const uint8_t *h, int64_t len, const uint8_t *q, int64_t qlen, int nocase) {
+  if (h == NULL || q == NULL || qlen <= 0 || len < qlen) {
+    return -1;
+  }
+
+  SageFindKeys k;
+  sage_find_keys(q, qlen, nocase, &k);
+  int64_t i = len - qlen; // highest candidate not yet checked
+#if defined(SAGE_FIND_SSE2) || defined(SAGE_FIND_NEON)
+  for (; i - (SAGE_FIND_BLOCK - 1) >= 0; i -= SAGE_FIND_BLOCK) {
+    const int64_t lo = i - (SAGE_FIND_BLOCK - 1);
+    uint64_t m = sage_find_mask16(h + lo, &k);
+    while (m != 0) {
+      int top = 63 - __builtin_clzll(m);
+      int64_t at = lo + (top >> SAGE_FIND_LANE_SHIFT);
+      if (sage_find_eq(h + at, q, qlen, nocase)) {
+        return at;
+      }
+      m &= ~(1ULL << top);
+    }
+  }
+#endif
+  for (; i >= 0; i--) {
+    if (sage_find_key_at(h + i, &k) && sage_find_eq(h + i, q, qlen, nocase)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Offset of the last byte equal to `byte` in `p[0..len)`, or -1.
+int64_t sage_find_byte_rev(const uint8_t *p, int64_t len, int byte) {
+  if (p == NULL || len <= 0) {
+    return -1;
+  }
+
+  const uint8_t b = (uint8_t)byte;
+  int64_t i = len;
+#if defined(SAGE_FIND_SSE2)
+  const __m128i n = _mm_set1_epi8((char)b);
+  for (; i >= SAGE_FIND_BLOCK; i -= SAGE_FIND_BLOCK) {
+    uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i - SAGE_FIND_BLOCK)), n));
+    if (m != 0) {
+      return i - SAGE_FIND_BLOCK + (31 - __builtin_clz(m));
+    }
+  }
+#elif defined(SAGE_FIND_NEON)
+  const uint8x16_t n = vdupq_n_u8(b);
+  for (; i >= SAGE_FIND_BLOCK; i -= SAGE_FIND_BLOCK) {
+    uint8x8_t nib = vshrn_n_u16(vreinterpretq_u16_u8(vceqq_u8(vld1q_u8(p + i - SAGE_FIND_BLOCK), n)), 4);
+    uint64_t m = vget_lane_u64(vreinterpret_u64_u8(nib), 0);
+    if (m != 0) {
+      return i - SAGE_FIND_BLOCK + ((63 - __builtin_clzll(m)) >> 2);
+    }
+  }
+#endif
+  while (i > 0) {
+    i--;
+    if (p[i] == b) {
+      return i;
+    }
+  }
+  return -1;
+}
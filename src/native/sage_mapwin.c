@@ -0,0 +1,342 @@
+// Residency control for large read-only mappings (`sage::map_window`).
+//
+// The pager keeps one contiguous mapping per file (readers do pointer
+// arithmetic on it), so address space is reserved once but never needs to be
+// resident as a whole. This file splits a mapping into fixed windows and keeps
+// only those near the viewport and the background scans:
+//
+//   view    windows around the viewport. Prefetched with MADV_WILLNEED and
+//           never dropped while in view.
+//   cursor  each background scan (indexer, search, match index, filter,
+//           highlight checkpoints) reads forward from its last reported
+//           offset, up to a span the scan declares (parallel workers and
+//           progress batching read past what they report). The span (at
+//           most the ceiling) is counted as resident, a few windows past it
+//           are MADV_SEQUENTIAL (deep readahead), and windows a scan leaves
+//           behind are dropped right away with MADV_DONTNEED.
+//   rest    MADV_RANDOM, so a jump faults in what it reads and nothing more.
+//
+// Touched windows are kept in LRU order; past the resident ceiling the least
+// recently used ones are dropped, then if need be the scans' spans (not
+// their current windows), which are only faulted in again when read.
+//
+// Dropping only discards this process's page table entries of an unmodified
+// mapping: the ceiling bounds our RSS, not the page cache. The pages stay
+// cached until the kernel reclaims them (a later read may find them there),
+// and nothing here holds the file descriptor POSIX_FADV_DONTNEED would need.
+//
+// Every call passes the mapping's current base and length: when the pager
+// remaps (tab switch, streaming growth) the tracking resets itself before any
+// advice is issued, so stale addresses are never advised.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SAGE_MAPWIN_CURSORS 5
+#define SAGE_MAPWIN_AHEAD 4    // windows advised sequential ahead of a cursor
+#define SAGE_MAPWIN_MIN_KEEP 4 // ceiling floor, in windows
+
+typedef struct {
+  uintptr_t base;
+  int64_t len;
+  int64_t win;         // window bytes (page multiple)
+  int64_t page;
+  int64_t max_windows; // resident ceiling
+  int64_t nwin;
+  uint64_t *used;      // LRU tick of the last touch per window; 0 = dropped
+  uint64_t tick;
+  int64_t resident;    // windows with used != 0
+  int64_t view_lo;     // windows [view_lo, view_hi) are in view
+  int64_t view_hi;
+  int64_t cursor[SAGE_MAPWIN_CURSORS];     // window of each cursor, or -1
+  int64_t cursor_end[SAGE_MAPWIN_CURSORS]; // last window its scan may read
+  int64_t dropped;     // bytes released so far
+} SageMapWin;
+
+static void sage_mapwin_advise(SageMapWin *w, int64_t lo, int64_t hi, int advice) {
+  if (lo < 0) {
+    lo = 0;
+  }
+  if (hi > w->nwin) {
+    hi = w->nwin;
+  }
+  if (lo >= hi) {
+    return;
+  }
+
+  int64_t off = lo * w->win;
+  int64_t end = hi * w->win;
+  if (end > w->len) {
+    end = w->len;
+  }
+  // The mapping extends to the end of its last page.
+  end = (end + w->page - 1) / w->page * w->page;
+  (void)madvise((void *)(w->base + (uintptr_t)off), (size_t)(end - off), advice);
+}
+
+static void sage_mapwin_reset(SageMapWin *w) {
+  free(w->used);
+  w->used = NULL;
+  w->base = 0;
+  w->len = 0;
+  w->nwin = 0;
+  w->resident = 0;
+  w->view_lo = 0;
+  w->view_hi = 0;
+  for (int i = 0; i < SAGE_MAPWIN_CURSORS; i++) {
+    w->cursor[i] = -1;
+    w->cursor_end[i] = -1;
+  }
+}
+
+// Follow the caller's current mapping. Returns 0 when there is nothing to
+// manage.
+static int sage_mapwin_sync(SageMapWin *w, uint64_t base, int64_t len) {
+  if (base == 0 || len <= 0) {
+    sage_mapwin_reset(w);
+    return 0;
+  }
+
+  if ((uintptr_t)base == w->base && len == w->len) {
+    return 1;
+  }
+
+  int64_t nwin = (len + w->win - 1) / w->win;
+  if ((uintptr_t)base != w->base || len < w->len) {
+    sage_mapwin_reset(w);
+  }
+
+  int64_t old = w->nwin;
+  if (nwin != old) {
+    uint64_t *u = realloc(w->used, (size_t)nwin * sizeof(uint64_t));
+    if (u == NULL) {
+      sage_mapwin_reset(w);
+      return 0;
+    }
+    if (nwin > old) {
+      memset(u + old, 0, (size_t)(nwin - old) * sizeof(uint64_t));
+    }
+    w->used = u;
+  }
+
+  w->base = (uintptr_t)base;
+  w->len = len;
+  w->nwin = nwin;
+  // A new mapping (or the grown tail) starts out random-access.
+  sage_mapwin_advise(w, old > 0 ? old - 1 : 0, nwin, MADV_RANDOM);
+  return 1;
+}
+
+// 2: in view or under a cursor; 1: in a cursor's span past it; 0: neither.
+static int sage_mapwin_protected(const SageMapWin *w, int64_t i) {
+  if (i >= w->view_lo && i < w->view_hi) {
+    return 2;
+  }
+
+  int level = 0;
+  for (int c = 0; c < SAGE_MAPWIN_CURSORS; c++) {
+    if (w->cursor[c] == i) {
+      return 2;
+    }
+    if (w->cursor[c] >= 0 && i > w->cursor[c] && i <= w->cursor_end[c]) {
+      level = 1;
+    }
+  }
+
+  return level;
+}
+
+static void sage_mapwin_touch(SageMapWin *w, int64_t i) {
+  if (w->used[i] == 0) {
+    w->resident++;
+  }
+  w->used[i] = ++w->tick;
+}
+
+static void sage_mapwin_drop(SageMapWin *w, int64_t i) {
+  sage_mapwin_advise(w, i, i + 1, MADV_DONTNEED);
+  sage_mapwin_advise(w, i, i + 1, MADV_RANDOM);
+  if (w->used[i] != 0) {
+    w->used[i] = 0;
+    w->resident--;
+  }
+
+  int64_t bytes = w->len - (i * w->win);
+  w->dropped += bytes < w->win ? bytes : w->win;
+}
+
+// Drop least recently used windows until the ceiling holds: unprotected ones
+// first, then windows in the scans' spans. The view and the windows under the
+// cursors are never dropped.
+static void sage_mapwin_enforce(SageMapWin *w) {
+  int level = 0;
+  while (w->resident > w->max_windows && level < 2) {
+    int64_t victim = -1;
+    for (int64_t i = 0; i < w->nwin; i++) {
+      if (w->used[i] != 0 && sage_mapwin_protected(w, i) <= level && (victim < 0 || w->used[i] < w->used[victim])) {
+        victim = i;
+      }
+    }
+
+    if (victim < 0) {
+      level++;
+      continue;
+    }
+
+    sage_mapwin_drop(w, victim);
+  }
+}
+
+// `win` bytes per window (rounded up to pages); at most `max_bytes` resident.
+void *sage_mapwin_new(int64_t win, int64_t max_bytes) {
+  if (win <= 0) {
+    return NULL;
+  }
+
+  SageMapWin *w = calloc(1, sizeof(SageMapWin));
+  if (w == NULL) {
+    return NULL;
+  }
+
+  long page = sysconf(_SC_PAGESIZE);
+  w->page = page > 0 ? (int64_t)page : 4096;
+  w->win = (win + w->page - 1) / w->page * w->page;
+  w->max_windows = max_bytes / w->win;
+  if (w->max_windows < SAGE_MAPWIN_MIN_KEEP) {
+    w->max_windows = SAGE_MAPWIN_MIN_KEEP;
+  }
+  sage_mapwin_reset(w);
+  return w;
+}
+
+void sage_mapwin_free(void *h) {
+  SageMapWin *w = h;
+  if (w == NULL) {
+    return;
+  }
+
+  free(w->used);
+  free(w);
+}
+
+// The view shows `[off, off+n)`: keep it and one window either side resident.
+void sage_mapwin_view(void *h, uint64_t base, int64_t len, int64_t off, int64_t n) {
+  SageMapWin *w = h;
+  if (w == NULL || !sage_mapwin_sync(w, base, len)) {
+    return;
+  }
+
+  if (off < 0) {
+    off = 0;
+  }
+  if (n < 1) {
+    n = 1;
+  }
+
+  int64_t lo = off / w->win - 1;
+  int64_t hi = (off + n - 1) / w->win + 2;
+  if (lo < 0) {
+    lo = 0;
+  }
+  if (hi > w->nwin) {
+    hi = w->nwin;
+  }
+
+  for (int64_t i = lo; i < hi; i++) {
+    if (w->used[i] == 0) {
+      sage_mapwin_advise(w, i, i + 1, MADV_WILLNEED);
+    }
+    sage_mapwin_touch(w, i);
+  }
+
+  w->view_lo = lo;
+  w->view_hi = hi;
+  sage_mapwin_enforce(w);
+}
+
+// Cursor `which` scans forward and is now at `off`, and may read up to `span`
+// bytes past it before reporting again; `off < 0` ends the scan.
+void sage_mapwin_cursor(void *h, uint64_t base, int64_t len, int which, int64_t off, int64_t span) {
+  SageMapWin *w = h;
+  if (w == NULL || which < 0 || which >= SAGE_MAPWIN_CURSORS || !sage_mapwin_sync(w, base, len)) {
+    return;
+  }
+
+  int64_t prev = w->cursor[which];
+  int64_t prev_end = w->cursor_end[which];
+  if (off < 0) {
+    if (prev < 0) {
+      return;
+    }
+    w->cursor[which] = -1;
+    w->cursor_end[which] = -1;
+    sage_mapwin_advise(w, prev, prev_end + 1 + SAGE_MAPWIN_AHEAD, MADV_RANDOM);
+    return;
+  }
+
+  int64_t i = off / w->win;
+  if (i >= w->nwin) {
+    i = w->nwin - 1;
+  }
+  // At least the window after the cursor, as before spans were reported.
+  int64_t end = span > 0 ? (off + span - 1) / w->win : i + 1;
+  if (end < i + 1) {
+    end = i + 1;
+  }
+  // Never more than the ceiling (a search job's read-ahead is up to 1 GiB).
+  if (end - i + 1 > w->max_windows) {
+    end = i + w->max_windows - 1;
+  }
+  if (end >= w->nwin) {
+    end = w->nwin - 1;
+  }
+  if (i == prev && end == prev_end) {
+    return;
+  }
+
+  w->cursor[which] = i;
+  w->cursor_end[which] = end;
+  if (prev >= 0 && i > prev) {
+    // Behind the scan: nothing will read it again soon.
+    for (int64_t j = prev; j < i; j++) {
+      if (!sage_mapwin_protected(w, j)) {
+        sage_mapwin_drop(w, j);
+      }
+    }
+  } else if (prev >= 0 && i < prev) {
+    // Restarted (wrapped search, rebuilt index).
+    sage_mapwin_advise(w, prev, prev_end + 1 + SAGE_MAPWIN_AHEAD, MADV_RANDOM);
+  }
+
+  sage_mapwin_advise(w, i, end + 1 + SAGE_MAPWIN_AHEAD, MADV_SEQUENTIAL);
+  for (int64_t j = i; j <= end; j++) {
+    sage_mapwin_touch(w, j);
+  }
+  sage_mapwin_enforce(w);
+}
+
+// Bytes of the mapping currently kept resident (tracked windows).
+int64_t sage_mapwin_resident(void *h) {
+  SageMapWin *w = h;
+  return w == NULL ? 0 : w->resident * w->win;
+}
+
+// Bytes released with MADV_DONTNEED so far (unmapped from this process; the
+// page cache may still hold them).
+int64_t sage_mapwin_dropped(void *h) {
+  SageMapWin *w = h;
+  return w == NULL ? 0 : w->dropped;
+}
+
+// Whether the window holding `off` is counted as resident.
+int sage_mapwin_has(void *h, int64_t off) {
+  SageMapWin *w = h;
+  if (w == NULL || off < 0 || w->win <= 0 || off / w->win >= w->nwin) {
+    return 0;
+  }
+  return w->used[off / w->win] != 0;
+}
@@ -0,0 +1,366 @@
+// Several literals searched at once (`/a\|b\|c` in literal mode, `sage::find`).
+//
+// The terms are compiled into one block holding an Aho-Corasick automaton
+// whose failure links are folded into a full 256-way transition table, so a
+// scan is one table load per haystack byte whatever the number of terms. With
+// ASCII case folding the terms are stored lowercased and the uppercase columns
+// copy the lowercase ones, so `-i` costs nothing extra at scan time.
+//
+// The block holds offsets only (no pointers): callers copy it into background
+// jobs like a plain query. Each state records the longest and the shortest
+// term ending there; the longest gives the leftmost start for a forward
+// search, the shortest the rightmost start for a reverse one.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAGE_MULTI_MAGIC "\0sagemul"
+#define SAGE_MULTI_MAX_BYTES 1024 // total term bytes; bounds the table to ~1 MiB
+#define SAGE_MULTI_REV_CHUNK 65536
+
+// Header (u32 words after the 8-byte magic).
+enum {
+  SAGE_MULTI_H_TOTAL = 0,
+  SAGE_MULTI_H_STATES,
+  SAGE_MULTI_H_TERMS,
+  SAGE_MULTI_H_MIN_LEN,
+  SAGE_MULTI_H_MAX_LEN,
+  SAGE_MULTI_H_NOCASE,
+  SAGE_MULTI_H_WORDS,
+};
+
+// Layout after the header:
+//   terms:   n_terms x [off, len] (u32; `off` into the block)
+//   out_max: n_states u32 (term + 1 of the longest term ending here, 0: none)
+//   out_min: n_states u32 (shortest)
+//   delta:   n_states x 256 u32
+//   term bytes (folded with nocase)
+typedef struct {
+  uint32_t *h;
+  uint32_t *terms;
+  uint32_t *out_max;
+  uint32_t *out_min;
+  uint32_t *delta;
+} SageMulti;
+
+static inline uint8_t sage_multi_fold(uint8_t b) {
+  return (b >= 'A' && b <= 'Z') ? (uint8_t)(b + 32) : b;
+}
+
+static int sage_multi_view(const uint8_t *blob, int64_t len, SageMulti *m) {
+  const int64_t head = 8 + (SAGE_MULTI_H_WORDS * 4);
+  if (blob == NULL || len < head || memcmp(blob, SAGE_MULTI_MAGIC, 8) != 0) {
+    return 0;
+  }
+
+  m->h = (uint32_t *)(uintptr_t)(blob + 8);
+  if ((int64_t)m->h[SAGE_MULTI_H_TOTAL] != len) {
+    return 0;
+  }
+
+  uint32_t n_terms = m->h[SAGE_MULTI_H_TERMS];
+  uint32_t n_states = m->h[SAGE_MULTI_H_STATES];
+  m->terms = m->h + SAGE_MULTI_H_WORDS;
+  m->out_max = m->terms + (n_terms * 2);
+  m->out_min = m->out_max + n_states;
+  m->delta = m->out_min + n_states;
+  return 1;
+}
+
+// Split `q` on `\|`, skipping empty terms. Calls `fn` per term when non-NULL;
+// returns the term count and the total term bytes.
+static int64_t sage_multi_split(const uint8_t *q, int64_t qlen, int64_t *bytes, void (*fn)(void *, const uint8_t *, int64_t), void *ctx) {
+  int64_t n = 0;
+  int64_t total = 0;
+  int64_t s = 0;
+  for (int64_t i = 0; i <= qlen; i++) {
+    int sep = i + 1 < qlen && q[i] == '\\' && q[i + 1] == '|';
+    if (i < qlen && !sep) {
+      continue;
+    }
+    if (i > s) {
+      if (fn != NULL) {
+        fn(ctx, q + s, i - s);
+      }
+      n++;
+      total += i - s;
+    }
+    i += sep;
+    s = i + 1;
+  }
+  *bytes = total;
+  return n;
+}
+
+static int64_t sage_multi_size_for(int64_t n_terms, int64_t bytes) {
+  int64_t n_states = bytes + 1;
+  int64_t words = SAGE_MULTI_H_WORDS + (n_terms * 2) + (n_states * 2) + (n_states * 256);
+  return 8 + (words * 4) + bytes;
+}
+
+// Bytes needed to compile `q`, or 0 when it is not a multi-term query (fewer
+// than two terms) or is too large.
+int64_t sage_multi_size(const uint8_t *q, int64_t qlen, int nocase) {
+  (void)nocase;
+  if (q == NULL || qlen <= 0) {
+    return 0;
+  }
+
+  int64_t bytes = 0;
+  int64_t n = sage_multi_split(q, qlen, &bytes, NULL, NULL);
+  if (n < 2 || bytes > SAGE_MULTI_MAX_BYTES) {
+    return 0;
+  }
+  return sage_multi_size_for(n, bytes);
+}
+
+typedef struct {
+  uint8_t *blob;
+  SageMulti m;
+  int nocase;
+  uint32_t n_terms;
+  uint32_t n_states;
+  uint32_t text_off;
+  uint32_t *depth;
+} SageMultiBuild;
+
+static void sage_multi_add(void *ctx, const uint8_t *t, int64_t len) {
+  SageMultiBuild *b = ctx;
+  uint8_t *dst = b->blob + b->text_off;
+  uint32_t s = 0;
+  for (int64_t i = 0; i < len; i++) {
+    uint8_t c = b->nocase ? sage_multi_fold(t[i]) : t[i];
+    dst[i] = c;
+    uint32_t *next = &b->m.delta[(s * 256) + c];
+    if (*next == 0) {
+      *next = b->n_states;
+      b->depth[b->n_states] = (uint32_t)(i + 1);
+      b->n_states++;
+    }
+    s = *next;
+  }
+
+  uint32_t k = b->n_terms++;
+  b->m.terms[k * 2] = b->text_off;
+  b->m.terms[(k * 2) + 1] = (uint32_t)len;
+  b->text_off += (uint32_t)len;
+  // A repeated term keeps its first index (and colour).
+  if (b->m.out_max[s] == 0) {
+    b->m.out_max[s] = k + 1;
+    b->m.out_min[s] = k + 1;
+  }
+}
+
+// Compile `q` into `out` (`sage_multi_size` bytes). Returns the bytes
+// written, or 0.
+int64_t sage_multi_build(const uint8_t *q, int64_t qlen, int nocase, uint8_t *out, int64_t cap) {
+  int64_t size = sage_multi_size(q, qlen, nocase);
+  if (size <= 0 || out == NULL || cap < size) {
+    return 0;
+  }
+
+  int64_t bytes = 0;
+  int64_t n = sage_multi_split(q, qlen, &bytes, NULL, NULL);
+  uint32_t max_states = (uint32_t)bytes + 1;
+  uint32_t *fail = calloc(max_states, sizeof(uint32_t));
+  uint32_t *depth = calloc(max_states, sizeof(uint32_t));
+  uint32_t *queue = calloc(max_states, sizeof(uint32_t));
+  if (fail == NULL || depth == NULL || queue == NULL) {
+    free(fail);
+    free(depth);
+    free(queue);
+    return 0;
+  }
+
+  memset(out, 0, (size_t)size);
+  memcpy(out, SAGE_MULTI_MAGIC, 8);
+  uint32_t *h = (uint32_t *)(uintptr_t)(out + 8);
+  h[SAGE_MULTI_H_TOTAL] = (uint32_t)size;
+  h[SAGE_MULTI_H_STATES] = max_states;
+  h[SAGE_MULTI_H_TERMS] = (uint32_t)n;
+  h[SAGE_MULTI_H_NOCASE] = nocase ? 1 : 0;
+
+  SageMultiBuild b;
+  b.blob = out;
+  sage_multi_view(out, size, &b.m);
+  b.nocase = nocase;
+  b.n_terms = 0;
+  b.n_states = 1;
+  b.text_off = (uint32_t)(size - bytes);
+  b.depth = depth;
+  // Trie edges first (0 = none: the root is never a child).
+  sage_multi_split(q, qlen, &bytes, sage_multi_add, &b);
+
+  uint32_t min_len = UINT32_MAX;
+  uint32_t max_len = 0;
+  for (uint32_t k = 0; k < b.n_terms; k++) {
+    uint32_t len = b.m.terms[(k * 2) + 1];
+    min_len = len < min_len ? len : min_len;
+    max_len = len > max_len ? len : max_len;
+  }
+  h[SAGE_MULTI_H_MIN_LEN] = min_len;
+  h[SAGE_MULTI_H_MAX_LEN] = max_len;
+
+  // Breadth-first: fold failure links into the table and inherit outputs.
+  uint32_t qh = 0;
+  uint32_t qt = 0;
+  for (int c = 0; c < 256; c++) {
+    uint32_t s = b.m.delta[c];
+    if (s != 0) {
+      fail[s] = 0;
+      queue[qt++] = s;
+    }
+  }
+  while (qh < qt) {
+    uint32_t r = queue[qh++];
+    uint32_t f = fail[r];
+    if (b.m.out_max[r] == 0) {
+      b.m.out_max[r] = b.m.out_max[f];
+    }
+    if (b.m.out_min[f] != 0) {
+      b.m.out_min[r] = b.m.out_min[f];
+    }
+    for (int c = 0; c < 256; c++) {
+      uint32_t *next = &b.m.delta[(r * 256) + c];
+      if (*next != 0) {
+        fail[*next] = b.m.delta[(f * 256) + c];
+        queue[qt++] = *next;
+      } else {
+        *next = b.m.delta[(f * 256) + c];
+      }
+    }
+  }
+
+  if (nocase) {
+    for (uint32_t s = 0; s < b.n_states; s++) {
+      uint32_t *row = &b.m.delta[s * 256];
+      for (int c = 'A'; c <= 'Z'; c++) {
+        row[c] = row[c + 32];
+      }
+    }
+  }
+
+  free(fail);
+  free(depth);
+  free(queue);
+  return size;
+}
+
+int sage_multi_is(const uint8_t *blob, int64_t len) {
+  SageMulti m;
+  return sage_multi_view(blob, len, &m);
+}
+
+int64_t sage_multi_min_len(const uint8_t *blob, int64_t len) {
+  SageMulti m;
+  return sage_multi_view(blob, len, &m) ? (int64_t)m.h[SAGE_MULTI_H_MIN_LEN] : 0;
+}
+
+int64_t sage_multi_max_len(const uint8_t *blob, int64_t len) {
+  SageMulti m;
+  return sage_multi_view(blob, len, &m) ? (int64_t)m.h[SAGE_MULTI_H_MAX_LEN] : 0;
+}
+
+static inline uint32_t sage_multi_term_len(const SageMulti *m, uint32_t k1) {
+  return m->terms[((k1 - 1) * 2) + 1];
+}
+
+// Leftmost match lying entirely within `[h, h+len)` (the longest one at that
+// start when several terms match there), or -1.
+int64_t sage_multi_fwd(const uint8_t *h, int64_t len, const uint8_t *blob, int64_t blob_len) {
+  SageMulti m;
+  if (h == NULL || len <= 0 || !sage_multi_view(blob, blob_len, &m)) {
+    return -1;
+  }
+
+  const uint32_t *delta = m.delta;
+  const int64_t max_len = m.h[SAGE_MULTI_H_MAX_LEN];
+  uint32_t s = 0;
+  int64_t best = -1;
+  for (int64_t i = 0; i < len; i++) {
+    s = delta[(s * 256) + h[i]];
+    uint32_t k1 = m.out_max[s];
+    if (k1 != 0) {
+      int64_t start = i + 1 - sage_multi_term_len(&m, k1);
+      if (best < 0 || start < best) {
+        best = start;
+      }
+    }
+    // Matches ending later start after `best`.
+    if (best >= 0 && i + 1 - max_len >= best) {
+      break;
+    }
+  }
+  return best;
+}
+
+// Start of the match lying entirely within `[h, h+len)` that starts last,
+// or -1. Scans 64 KiB chunks from the end, each from a fresh state.
+int64_t sage_multi_rev(const uint8_t *h, int64_t len, const uint8_t *blob, int64_t blob_len) {
+  SageMulti m;
+  if (h == NULL || len <= 0 || !sage_multi_view(blob, blob_len, &m)) {
+    return -1;
+  }
+
+  const uint32_t *delta = m.delta;
+  const int64_t max_len = m.h[SAGE_MULTI_H_MAX_LEN];
+  int64_t ce = len;
+  while (ce > 0) {
+    int64_t cs = ce > SAGE_MULTI_REV_CHUNK ? ce - SAGE_MULTI_REV_CHUNK : 0;
+    int64_t we = len - ce < max_len - 1 ? len : ce + max_len - 1;
+    uint32_t s = 0;
+    int64_t best = -1;
+    for (int64_t i = cs; i < we; i++) {
+      s = delta[(s * 256) + h[i]];
+      uint32_t k1 = m.out_min[s];
+      if (k1 != 0) {
+        int64_t start = i + 1 - sage_multi_term_len(&m, k1);
+        if (start < ce && start > best) {
+          best = start;
+        }
+      }
+    }
+    if (best >= 0) {
+      return best;
+    }
+    ce = cs;
+  }
+  return -1;
+}
+
+// Index of the longest term matching at `p` within `avail` bytes, or -1.
+int sage_multi_term_at(const uint8_t *p, int64_t avail, const uint8_t *blob, int64_t blob_len) {
+  SageMulti m;
+  if (p == NULL || avail <= 0 || !sage_multi_view(blob, blob_len, &m)) {
+    return -1;
+  }
+
+  const int nocase = m.h[SAGE_MULTI_H_NOCASE] != 0;
+  int best = -1;
+  uint32_t best_len = 0;
+  for (uint32_t k = 0; k < m.h[SAGE_MULTI_H_TERMS]; k++) {
+    uint32_t len = m.terms[(k * 2) + 1];
+    if ((int64_t)len > avail || len <= best_len) {
+      continue;
+    }
+    const uint8_t *t = blob + m.terms[k * 2];
+    uint32_t i = 0;
+    while (i < len && (nocase ? sage_multi_fold(p[i]) : p[i]) == t[i]) {
+      i++;
+    }
+    if (i == len) {
+      best = (int)k;
+      best_len = len;
+    }
+  }
+  return best;
+}
+
+int64_t sage_multi_term_bytes(const uint8_t *blob, int64_t blob_len, int k) {
+  SageMulti m;
+  if (!sage_multi_view(blob, blob_len, &m) || k < 0 || (uint32_t)k >= m.h[SAGE_MULTI_H_TERMS]) {
+    return 0;
+  }
+  return (int64_t)m.terms[((uint32_t)k * 2) + 1];
+}
@@ -0,0 +1,77 @@
+// Process-wide values published once (`sage::syntax` tables, highlighters and
+// the regex engine fingerprint).
+//
+// The Silk modules keep no mutable module state, so tables that every tab,
+// worker and modal should share for the life of the process (the mapped
+// syntax index, the highlighter cache) are parked here. The first publisher
+// of a slot wins; a caller that loses the race gets the winner's value back
+// and releases its own. `sage_swap_u64`, `sage_add_u64` and the
+// release/acquire word pair below are the other atomics the Silk side needs.
+
+#include <stdint.h>
+
+#define SAGE_ONCE_SLOTS 8
+
+static uint64_t sage_once_slots[SAGE_ONCE_SLOTS];
+
+// The value published in `slot`, or 0.
+uint64_t sage_once_get(int slot) {
+  if (slot < 0 || slot >= SAGE_ONCE_SLOTS) {
+    return 0;
+  }
+  return __atomic_load_n(&sage_once_slots[slot], __ATOMIC_ACQUIRE);
+}
+
+// Publish `value` in `slot` unless one already is; returns the slot's value
+// afterwards (`value` when this call won). 0 for a bad slot.
+uint64_t sage_once_publish(int slot, uint64_t value) {
+  if (slot < 0 || slot >= SAGE_ONCE_SLOTS || value == 0) {
+    return 0;
+  }
+  uint64_t expected = 0;
+  if (__atomic_compare_exchange_n(&sage_once_slots[slot], &expected, value, 0,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    return value;
+  }
+  return expected;
+}
+
+// Store `value` in the u64 word at `addr` and return what it held, as one
+// atomic step. Spool state blocks use it to hand ownership between the UI
+// and a background task that may be exiting at the same time.
+uint64_t sage_swap_u64(uint64_t addr, uint64_t value) {
+  if (addr == 0) {
+    return 0;
+  }
+  return __atomic_exchange_n((uint64_t *)(uintptr_t)addr, value,
+                             __ATOMIC_ACQ_REL);
+}
+
+// Store `value` in the u64 word at `addr` after every earlier store by this
+// thread. Background jobs fill in their result words first and then publish
+// the state word through here.
+void sage_store_release_u64(uint64_t addr, uint64_t value) {
+  if (addr == 0) {
+    return;
+  }
+  __atomic_store_n((uint64_t *)(uintptr_t)addr, value, __ATOMIC_RELEASE);
+}
+
+// Load the u64 word at `addr`; later loads see everything stored before the
+// matching `sage_store_release_u64`.
+uint64_t sage_load_acquire_u64(uint64_t addr) {
+  if (addr == 0) {
+    return 0;
+  }
+  return __atomic_load_n((uint64_t *)(uintptr_t)addr, __ATOMIC_ACQUIRE);
+}
+
+// Add `delta` to the u64 word at `addr` and return what it held before, as
+// one atomic step. Grep workers claim hits from a shared budget with it.
+uint64_t sage_add_u64(uint64_t addr, uint64_t delta) {
+  if (addr == 0) {
+    return 0;
+  }
+  return __atomic_fetch_add((uint64_t *)(uintptr_t)addr, delta,
+                            __ATOMIC_ACQ_REL);
+}
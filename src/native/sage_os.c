@@ -0,0 +1,59 @@
+// Host details that differ between platforms (`sage::os`).
+//
+// `struct stat` layout varies by libc and architecture (glibc x86_64,
+// aarch64 Linux and macOS all differ), so the Silk side never reads it
+// directly: `sage_stat` copies the fields `sage` uses into a fixed block of
+// u64 words. `sysconf` names are libc constants too (`_SC_NPROCESSORS_ONLN`
+// is 84 on glibc, 58 on macOS), as are most errno values.
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Words of the block filled by `sage_stat`.
+#define SAGE_STAT_DEV 0
+#define SAGE_STAT_INO 1
+#define SAGE_STAT_REGULAR 2
+#define SAGE_STAT_SIZE 3
+#define SAGE_STAT_MTIME_SEC 4
+#define SAGE_STAT_MTIME_NSEC 5
+
+// `stat(2)` `path` into the 6-word block at `out`; returns 0, or -1 (errno
+// set) when the path cannot be stat'ed.
+int sage_stat(const char *path, uint64_t out) {
+  uint64_t *w = (uint64_t *)(uintptr_t)out;
+  if (path == NULL || w == NULL) {
+    return -1;
+  }
+
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return -1;
+  }
+
+  w[SAGE_STAT_DEV] = (uint64_t)st.st_dev;
+  w[SAGE_STAT_INO] = (uint64_t)st.st_ino;
+  w[SAGE_STAT_REGULAR] = S_ISREG(st.st_mode) ? 1 : 0;
+  w[SAGE_STAT_SIZE] = (uint64_t)st.st_size;
+#if defined(__APPLE__)
+  w[SAGE_STAT_MTIME_SEC] = (uint64_t)st.st_mtimespec.tv_sec;
+  w[SAGE_STAT_MTIME_NSEC] = (uint64_t)st.st_mtimespec.tv_nsec;
+#else
+  w[SAGE_STAT_MTIME_SEC] = (uint64_t)st.st_mtim.tv_sec;
+  w[SAGE_STAT_MTIME_NSEC] = (uint64_t)st.st_mtim.tv_nsec;
+#endif
+  return 0;
+}
+
+// Online CPUs, or -1 when unknown.
+int64_t sage_online_cpus(void) {
+  return (int64_t)sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+// 1 when errno `e` means "try again" (EINTR, EAGAIN/EWOULDBLOCK).
+int sage_errno_transient(int e) {
+  return e == EINTR || e == EAGAIN || e == EWOULDBLOCK;
+}
@@ -0,0 +1,247 @@
+// Child processes whose output is read while they run (`sage::proc`).
+//
+// `std::process::Command.output()` waits for the child and buffers everything
+// it printed. The `find_cmd` modal instead wants the first lines as soon as
+// they are written and a way to stop a broad search early, so this spawns the
+// child with non-blocking stdout/stderr pipes and lets the UI poll them on its
+// idle ticks. stdin is /dev/null, as with `Stdio::Null`. The child leads its
+// own process group, so stopping it also stops whatever a wrapper script or
+// pipeline started.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+#define SAGE_PROC_MAX_ARGS 4096
+
+// sage_proc_wait results besides an exit code.
+#define SAGE_PROC_RUNNING (-2)
+#define SAGE_PROC_SIGNALED (-1)
+
+typedef struct {
+  pid_t pid;
+  int out_fd;
+  int err_fd;
+  int reaped;
+  int status; // exit code or SAGE_PROC_SIGNALED once reaped
+} SageProc;
+
+static __thread int sage_proc_errno;
+
+static int sage_proc_pipe(int fds[2]) {
+  if (pipe(fds) != 0) {
+    return -1;
+  }
+  // The read ends are polled; the write ends are the child's.
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return 0;
+}
+
+// Spawn `argv`, given as `len` bytes of NUL-terminated strings (program
+// first, looked up in PATH). Returns 0 and records errno on failure (E2BIG
+// past SAGE_PROC_MAX_ARGS arguments).
+uint64_t sage_proc_spawn(const char *block, int64_t len) {
+  sage_proc_errno = 0;
+  if (block == NULL || len <= 0) {
+    sage_proc_errno = EINVAL;
+    return 0;
+  }
+
+  char *argv[SAGE_PROC_MAX_ARGS + 1];
+  int argc = 0;
+  int64_t off = 0;
+  while (off < len && argc < SAGE_PROC_MAX_ARGS) {
+    argv[argc++] = (char *)block + off;
+    off += (int64_t)strnlen(block + off, (size_t)(len - off)) + 1;
+  }
+  argv[argc] = NULL;
+  if (off < len) {
+    // More arguments than fit: fail rather than drop the last paths.
+    sage_proc_errno = E2BIG;
+    return 0;
+  }
+  if (argc == 0 || off > len || block[len - 1] != 0) {
+    sage_proc_errno = EINVAL;
+    return 0;
+  }
+
+  SageProc *p = calloc(1, sizeof(*p));
+  if (p == NULL) {
+    sage_proc_errno = ENOMEM;
+    return 0;
+  }
+
+  int out_p[2] = { -1, -1 };
+  int err_p[2] = { -1, -1 };
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  int fa_ok = 0;
+  int attr_ok = 0;
+  int rc = 0;
+  if (sage_proc_pipe(out_p) != 0 || sage_proc_pipe(err_p) != 0) {
+    rc = errno;
+    goto fail;
+  }
+
+  rc = posix_spawn_file_actions_init(&fa);
+  if (rc != 0) {
+    goto fail;
+  }
+  fa_ok = 1;
+  posix_spawn_file_actions_addopen(&fa, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&fa, out_p[1], 1);
+  posix_spawn_file_actions_adddup2(&fa, err_p[1], 2);
+
+  rc = posix_spawnattr_init(&attr);
+  if (rc != 0) {
+    goto fail;
+  }
+  attr_ok = 1;
+  rc = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  if (rc == 0) {
+    rc = posix_spawnattr_setpgroup(&attr, 0);
+  }
+  if (rc != 0) {
+    goto fail;
+  }
+
+  rc = posix_spawnp(&p->pid, argv[0], &fa, &attr, argv, environ);
+  posix_spawn_file_actions_destroy(&fa);
+  posix_spawnattr_destroy(&attr);
+  fa_ok = 0;
+  attr_ok = 0;
+  if (rc != 0) {
+    goto fail;
+  }
+
+  close(out_p[1]);
+  close(err_p[1]);
+  p->out_fd = out_p[0];
+  p->err_fd = err_p[0];
+  return (uint64_t)(uintptr_t)p;
+
+fail:
+  if (fa_ok) {
+    posix_spawn_file_actions_destroy(&fa);
+  }
+  if (attr_ok) {
+    posix_spawnattr_destroy(&attr);
+  }
+  for (int i = 0; i < 2; i++) {
+    if (out_p[i] >= 0) {
+      close(out_p[i]);
+    }
+    if (err_p[i] >= 0) {
+      close(err_p[i]);
+    }
+  }
+  free(p);
+  sage_proc_errno = rc != 0 ? rc : EIO;
+  return 0;
+}
+
+int sage_proc_last_error(void) {
+  return sage_proc_errno;
+}
+
+// Read what is available on stdout (`stream` 1) or stderr (2): the byte
+// count, 0 at end of stream, -1 when nothing is ready yet, -2 on error.
+int64_t sage_proc_read(uint64_t h, int stream, uint8_t *buf, int64_t cap) {
+  SageProc *p = (SageProc *)(uintptr_t)h;
+  if (p == NULL || buf == NULL || cap <= 0) {
+    return -2;
+  }
+
+  int *fd = stream == 2 ? &p->err_fd : &p->out_fd;
+  if (*fd < 0) {
+    return 0;
+  }
+
+  for (;;) {
+    ssize_t n = read(*fd, buf, (size_t)cap);
+    if (n > 0) {
+      return (int64_t)n;
+    }
+    if (n == 0) {
+      close(*fd);
+      *fd = -1;
+      return 0;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return -1;
+    }
+    return -2;
+  }
+}
+
+static void sage_proc_note_status(SageProc *p, int st) {
+  p->reaped = 1;
+  p->status = WIFEXITED(st) ? WEXITSTATUS(st) : SAGE_PROC_SIGNALED;
+}
+
+// Exit code once the child has exited (-1: killed by a signal), else
+// SAGE_PROC_RUNNING. Never blocks.
+int sage_proc_wait(uint64_t h) {
+  SageProc *p = (SageProc *)(uintptr_t)h;
+  if (p == NULL) {
+    return SAGE_PROC_SIGNALED;
+  }
+
+  if (!p->reaped) {
+    int st = 0;
+    pid_t r;
+    do {
+      r = waitpid(p->pid, &st, WNOHANG);
+    } while (r < 0 && errno == EINTR);
+    if (r == p->pid) {
+      sage_proc_note_status(p, st);
+    } else if (r < 0) {
+      p->reaped = 1;
+      p->status = SAGE_PROC_SIGNALED;
+    } else {
+      return SAGE_PROC_RUNNING;
+    }
+  }
+
+  return p->status;
+}
+
+// Kill the child's process group if the child is still running, reap it and
+// release everything. Once the child has been reaped its pid may name another
+// group, so the group is left alone then.
+void sage_proc_free(uint64_t h) {
+  SageProc *p = (SageProc *)(uintptr_t)h;
+  if (p == NULL) {
+    return;
+  }
+
+  if (p->out_fd >= 0) {
+    close(p->out_fd);
+  }
+  if (p->err_fd >= 0) {
+    close(p->err_fd);
+  }
+
+  if (!p->reaped) {
+    kill(-p->pid, SIGKILL);
+    int st = 0;
+    while (waitpid(p->pid, &st, 0) < 0 && errno == EINTR) {
+    }
+  }
+
+  free(p);
+}
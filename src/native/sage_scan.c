@@ -0,0 +1,107 @@
+// Byte-scanning kernels for the line indexer (`sage::index`).
+//
+// Counting works on 64-byte blocks: compare every byte against the needle,
+// collapse the result into a 64-bit mask and popcount it. Exact positions are
+// only resolved inside the one block that holds the wanted occurrence, so
+// finding "the 256th newline from here" costs a popcount per 64 bytes instead
+// of a `memchr` call per line.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SAGE_SCAN_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SAGE_SCAN_NEON 1
+#endif
+
+#define SAGE_SCAN_BLOCK 64
+
+// Bit `i` of the result is set iff `p[i] == byte` (i in [0, 64)).
+static inline uint64_t sage_scan_mask64(const uint8_t *p, uint8_t byte) {
+#if defined(SAGE_SCAN_SSE2)
+  const __m128i n = _mm_set1_epi8((char)byte);
+  uint64_t m0 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 0)), n));
+  uint64_t m1 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), n));
+  uint64_t m2 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), n));
+  uint64_t m3 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), n));
+  return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+#elif defined(SAGE_SCAN_NEON)
+  // NEON has no movemask: weight each lane by its bit and fold with pairwise
+  // adds until one byte holds the 8 bits of each 8-lane group.
+  static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+  const uint8x16_t w = vld1q_u8(weights);
+  const uint8x16_t n = vdupq_n_u8(byte);
+  uint8x16_t c0 = vandq_u8(vceqq_u8(vld1q_u8(p + 0), n), w);
+  uint8x16_t c1 = vandq_u8(vceqq_u8(vld1q_u8(p + 16), n), w);
+  uint8x16_t c2 = vandq_u8(vceqq_u8(vld1q_u8(p + 32), n), w);
+  uint8x16_t c3 = vandq_u8(vceqq_u8(vld1q_u8(p + 48), n), w);
+  uint8x16_t s0 = vpaddq_u8(c0, c1);
+  uint8x16_t s1 = vpaddq_u8(c2, c3);
+  s0 = vpaddq_u8(s0, s1);
+  s0 = vpaddq_u8(s0, s0);
+  return vgetq_lane_u64(vreinterpretq_u64_u8(s0), 0);
+#else
+  uint64_t m = 0;
+  for (int i = 0; i < SAGE_SCAN_BLOCK; i++) {
+    m |= (uint64_t)(p[i] == byte) << i;
+  }
+  return m;
+#endif
+}
+
+// Number of bytes equal to `byte` in `[p, p+len)`.
+int64_t sage_scan_count_byte(const uint8_t *p, int64_t len, int byte) {
+  if (p == NULL || len <= 0) {
+    return 0;
+  }
+
+  const uint8_t b = (uint8_t)byte;
+  int64_t total = 0;
+  int64_t i = 0;
+  for (; i + SAGE_SCAN_BLOCK <= len; i += SAGE_SCAN_BLOCK) {
+    total += __builtin_popcountll(sage_scan_mask64(p + i, b));
+  }
+
+  for (; i < len; i++) {
+    total += (p[i] == b);
+  }
+
+  return total;
+}
+
+// Index of the `n`th (1-based) byte equal to `byte` in `[p, p+len)`, or -1
+// when there are fewer than `n`.
+int64_t sage_scan_find_nth_byte(const uint8_t *p, int64_t len, int byte, int64_t n) {
+  if (p == NULL || len <= 0 || n <= 0) {
+    return -1;
+  }
+
+  const uint8_t b = (uint8_t)byte;
+  int64_t i = 0;
+  for (; i + SAGE_SCAN_BLOCK <= len; i += SAGE_SCAN_BLOCK) {
+    uint64_t m = sage_scan_mask64(p + i, b);
+    int64_t c = __builtin_popcountll(m);
+    if (c < n) {
+      n -= c;
+      continue;
+    }
+
+    // Drop the first n-1 matches; the lowest remaining bit is the answer.
+    while (--n > 0) {
+      m &= m - 1;
+    }
+
+    return i + __builtin_ctzll(m);
+  }
+
+  for (; i < len; i++) {
+    if (p[i] == b && --n == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}